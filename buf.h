@@ -1,31 +1,59 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
 #include "db.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
-// declarations for buffer pool hash table
+// declarations for buffer pool hash table.
+// One slot of the open addressing table; file == NULL marks an empty slot
 struct hashBucket
 {
 	File*	file;    // pointer a file object (more on this below)
 	int	pageNo;  // page number within a file
 	int	frameNo; // frame number of page in the buffer pool
-	hashBucket* 	next;	 // next node in the hash table
 };
 
 
-// hash table to keep track of pages in the buffer pool
+// number of latches striped over the hash table
+const int BUFHASHLATCHES = 64;
+
+// hash table to keep track of pages in the buffer pool.
+// The table is split into BUFHASHLATCHES partitions, each a flat array
+// searched by linear probing and guarded by its own latch.  A key
+// always probes within its own partition, so the table does no locking
+// of its own: callers must hold latchFor(file,pageNo) around
+// insert/lookup/remove as well as around whatever they do to the
+// frame based on the answer.  Partitions are sized up front from the
+// expected number of entries and only reallocated if one fills up.
 class BufHashTbl
 {
 private:
-    int HTSIZE;
-    hashBucket**  ht; // actual hash table
-    int	 hash(const File* file, const int pageNo); // returns value between 0 and HTSIZE-1
+    int NUMLATCHES;       // number of partitions
+    hashBucket** ht;      // slots of each partition
+    int* partSize;        // number of slots in each partition, a power of 2
+    int* partUsed;        // number of slots in use in each partition
+    std::mutex* latches;  // one latch per partition
+    unsigned long hash(const File* file, const int pageNo) const; // mixes both into 64 bits
+    void grow(const int part); // double the size of a partition
 
 public:
-    BufHashTbl(const int htSize);  // constructor
+    BufHashTbl(const int htSize);  // constructor, htSize = expected entries
     ~BufHashTbl(); // destructor
+
+    // latch guarding the partition that (file,pageNo) hashes to
+  std::mutex& latchFor(const File* file, const int pageNo)
+  {
+    return latches[hash(file, pageNo) % NUMLATCHES];
+  }
 	
     // insert entry into hash table mapping (file,pageNo) to frameNo;
     // returns 0 if OK, HASHTBLERROR if an error occurred
@@ -43,18 +71,28 @@ public:
 
 
 class BufMgr;  //forward declaration of BufMgr class 
+class BufPolicy;  //forward declaration of BufPolicy class 
 
-// class for maintaining information about buffer pool frames
+// class for maintaining information about buffer pool frames.
+// pinCnt is only raised while holding the hash latch of the page the
+// frame holds, so a frame seen unpinned under that latch stays
+// unpinned until the latch is released.  latch is held by whoever is
+// evicting, loading or writing out the frame.
 class BufDesc {
     friend class BufMgr;
+    friend class BufPolicy;
 private:
   File* file;   // pointer to file object
   int   pageNo; // page within file
   int	frameNo;  // frame # of frame
-  int   pinCnt; // number of times this page has been pinned
-  bool 	dirty;	  // true if dirty;  false otherwise
-  bool 	valid;   // true if page is valid
-  bool  refbit;	 // has this buffer frame been reference recently
+  std::atomic<int>  pinCnt; // number of times this page has been pinned
+  std::atomic<bool> dirty;  // true if dirty;  false otherwise
+  std::atomic<bool> valid;  // true if page is valid (and its contents loaded)
+  std::atomic<bool> refbit; // has this buffer frame been reference recently
+  std::atomic<bool> prefetched; // read ahead and not referenced since
+  std::mutex latch;         // frame latch
+  int   fileNext;  // next frame holding a page of file (File::frameList), -1 = none
+  int   filePrev;  // previous one
 
   void Clear() {  // initialize buffer frame for a new user
     	pinCnt = 0;
@@ -74,68 +112,397 @@ private:
   }
 
   BufDesc() {
+      refbit = false;
+      prefetched = false;
+      fileNext = filePrev = -1;
       Clear();
   }
 };
 
 
-struct BufStats
+// A statistics counter.  64 bits so that it does not wrap in a long
+// running process.  Counters are bumped on every hit by every thread,
+// so each one is split into shards on cache lines of their own; a
+// thread always adds to the same shard, with a relaxed atomic, and
+// reading the counter sums them.  Reads may miss concurrent updates.
+// Copying a counter (or a BufStats) takes a snapshot of its value.
+const int COUNTERSHARDS = 16;
+
+// shard of the calling thread, handed out round robin
+inline int counterShard()
+{
+  static std::atomic<int> next(0);
+  static thread_local int shard = next++ % COUNTERSHARDS;
+  return shard;
+}
+
+class Counter
+{
+  struct alignas(64) Shard
+  {
+    std::atomic<long long> n;
+  };
+  Shard shards[COUNTERSHARDS];
+
+public:
+  Counter() { *this = 0; }
+  Counter(const Counter& other) { *this = (long long)other; } // a snapshot
+  operator long long() const
+    {
+      long long sum = 0;
+      for (int i = 0; i < COUNTERSHARDS; i++)
+	sum += shards[i].n.load(std::memory_order_relaxed);
+      return sum;
+    }
+  void operator++(int) { *this += 1; }
+  void operator+=(const long long v)
+    {
+      shards[counterShard()].n.fetch_add(v, std::memory_order_relaxed);
+    }
+  Counter& operator=(const long long v)
+    {
+      shards[0].n.store(v, std::memory_order_relaxed);
+      for (int i = 1; i < COUNTERSHARDS; i++)
+	shards[i].n.store(0, std::memory_order_relaxed);
+      return *this;
+    }
+  Counter& operator=(const Counter& other)
+    {
+      return *this = (long long)other;
+    }
+};
+
+// Distribution of values in power of two buckets: bucket 0 counts
+// zeros and bucket i values in [2^(i-1), 2^i).
+const int HISTBUCKETS = 40;
+
+struct Histogram
 {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+  Counter buckets[HISTBUCKETS];
+
+  void add(const unsigned long long v)
+    {
+      int b = v == 0 ? 0 : 64 - __builtin_clzll(v);
+      buckets[b < HISTBUCKETS ? b : HISTBUCKETS - 1]++;
+    }
+  long long count() const;
+  long long percentile(const double p) const; // upper bound of its bucket
+  void clear();
+  void dump(ostream& out) const;   // as JSON
+};
+
+// what happened to the pages of one file; see BufMgr::dumpStats
+struct FileStats
+{
+  Counter hits;           // accesses that found the page in the pool
+  Counter misses;         // accesses that had to read it
+  Counter evictions;      // pages of the file chosen as victims
+  Counter dirtyevictions; // of those, dirty ones written out first
+  Counter diskreads;
+  Counter diskwrites;
 
   void clear()
     {
-      accesses = diskreads = diskwrites = 0;
+      hits = misses = evictions = dirtyevictions = 0;
+      diskreads = diskwrites = 0;
     }
-      
-  BufStats()
+};
+
+struct BufStats
+{
+  Counter accesses;     // Total number of accesses to buffer pool
+  Counter hits;         // of those, pages found in the pool
+  Counter misses;       // of those, pages that had to be read
+  Counter diskreads;    // Number of pages read from disk (including allocs)
+  Counter diskwrites;   // Number of pages written back to disk
+  Counter evictions;    // valid pages allocBuf took frames from
+  Counter fgwrites;     // of diskwrites, dirty victims written by allocBuf
+  Counter bgwrites;     // of diskwrites, pages cleaned by the background writer
+  Counter prefetched;   // pages read ahead (included in diskreads)
+  Counter prefetchhits;   // read ahead pages that were then referenced
+  Counter prefetchwaste;  // read ahead pages dropped without being referenced
+  Counter mappedreads;  // readPageRO calls served from a file mapping
+  Counter lookups;      // hash table lookups
+  Counter warmed;       // pages read back in by BufMgr::warmFile
+  Histogram sweeplen;   // frames the policy looked at to find allocBuf a frame
+  Histogram readlat;    // nsec per File::readPages call
+  Histogram writelat;   // nsec per File::writePage(s) call
+
+  void clear()
     {
-      clear();
+      accesses = hits = misses = 0;
+      diskreads = diskwrites = 0;
+      evictions = fgwrites = bgwrites = 0;
+      prefetched = prefetchhits = prefetchwaste = 0;
+      mappedreads = lookups = warmed = 0;
+      sweeplen.clear();
+      readlat.clear();
+      writelat.clear();
     }
 };
 
 
+// a page of a saved resident set, see BufMgr::saveResident
+struct ResidentPage
+{
+  int  pageNo;
+  bool refbit;
+};
+
+// most pages brought in by one read system call
+const int MAXREADRUN = 64;
+
+// most pages written out by one write system call
+const int MAXWRITERUN = 256;
+
+// sequential reads in a row after which a file is read ahead
+const int SEQTHRESHOLD = 2;
+
+// replacement policies that allocBuf can be built with
+enum ReplPolicy {
+  CLOCK,   // second chance over BufDesc::refbit
+  LRUK,    // LRU-2: evict the page whose second to last access is oldest
+  TWOQ     // 2Q: pages seen once sit in a FIFO, re-referenced ones in an LRU
+};
+
+// where the buffer pool memory comes from
+enum PoolAlloc {
+  HEAPPOOL,  // new Page[], every frame zeroed up front
+  MMAPPOOL,  // anonymous mapping: page aligned (as O_DIRECT wants) and
+             // zeroed by the kernel as frames are first touched
+  HUGEPOOL   // as MMAPPOOL, but in 2MB huge pages (MAP_HUGETLB), or
+             // advised for transparent huge pages if none are reserved
+};
+
+// Interface allocBuf uses to pick victims.  The buffer manager tells
+// the policy when frames are referenced, filled and emptied, and asks
+// it for candidates; it still does all the latching and checks each
+// candidate itself, so a policy only has to be right most of the time.
+// All methods may be called concurrently.
+class BufPolicy
+{
+protected:
+  BufDesc* bufTable;  // frame descriptors of the buffer manager
+  int      numBufs;   // number of frames
+
+  bool isPinned(const int frame) const { return bufTable[frame].pinCnt > 0; }
+  bool isValid(const int frame) const { return bufTable[frame].valid; }
+  bool testAndClearRef(const int frame) { return bufTable[frame].refbit.exchange(false); }
+
+public:
+  BufPolicy(BufDesc* table, const int bufs) : bufTable(table), numBufs(bufs) {}
+  virtual ~BufPolicy() {}
+
+  // build the policy selected by kind
+  static BufPolicy* create(const ReplPolicy kind, BufDesc* table, const int bufs);
+
+  // return a frame worth trying to reuse, skipping the first skip
+  // candidates (ones the caller already failed to claim); -1 if none.
+  // examined is set to the number of frames looked at to find it.
+  virtual int pickVictim(const int skip, int& examined) = 0;
+
+  // a pinned frame holding a page was referenced again.  Called on
+  // every hit, so it should not make concurrent readers wait for each
+  // other; the policy may note the reference and act on it later.
+  virtual void touched(const int frame) {}
+
+  // frame now holds (file,pageNo)
+  virtual void loaded(const int frame, const File* file, const int pageNo) {}
+
+  // frame no longer holds (file,pageNo)
+  virtual void freed(const int frame, const File* file, const int pageNo) {}
+
+  // fill frames[] with up to max frames in the order the policy expects
+  // to evict them, for the background writer; returns how many
+  virtual int nextVictims(int frames[], const int max) = 0;
+};
+
+
+// The buffer manager may be used from any number of threads at once;
+class BufMgr;
+
+// A pin on a page, from the readPage and allocPage overloads that fill
+// one in.  It knows the frame the page is in, so unpinning it takes no
+// hash table lookup, and it unpins the page when it goes out of scope.
+// After unpin() it still knows the page: repin() pins it again without
+// a lookup if the page is still in the same frame, and reads it back in
+// otherwise.  Handles can be moved but not copied.
+class PageHandle
+{
+  friend class BufMgr;
+
+public:
+  PageHandle() : mgr(NULL), file(NULL), pageNo(-1), frameNo(-1),
+		 pinned(false) {}
+  PageHandle(PageHandle&& other);
+  PageHandle& operator=(PageHandle&& other);
+  PageHandle(const PageHandle&) = delete;
+  PageHandle& operator=(const PageHandle&) = delete;
+  ~PageHandle();
+
+  Page* page() const;            // the page, NULL unless pinned
+  Page* operator->() const { return page(); }
+  int   getPageNo() const { return pageNo; }
+  bool  isPinned() const { return pinned; }
+
+  void  markDirty();             // the page has been changed
+  const Status unpin();
+  const Status repin();
+
+private:
+  BufMgr* mgr;
+  File*   file;
+  int     pageNo;
+  int     frameNo;
+  bool    pinned;
+};
+
+// see buf.C for the latching protocol.
 class BufMgr 
 {
 private:
-  unsigned int 	 clockHand;
   int   	 numBufs;    	// Number of pages in buffer pool
   BufHashTbl*    hashTable;  	// hash table mapping (File, page) to frame
+  BufPolicy*     policy;        // replacement policy used by allocBuf
   BufDesc*	 bufTable;  	// vector of status info, 1 per page
+  PoolAlloc	 poolAlloc;	// how bufPool was allocated
+  size_t	 poolBytes;	// size of the bufPool mapping, if mapped
+  unsigned long	 poolId;	// tells this pool from the ones before it
   BufStats	 bufStats;	// buffer pool statistics
+  std::atomic<int> dirtyCount;  // number of dirty frames
+  std::atomic<int> readAhead;   // pages to read ahead of a sequential reader, 0 = off
 
-  const Status allocBuf(int & frame);   // allocate a free frame.  
+  // background writer, see startFlusher()
+  std::thread*   flusher;       // NULL when not running
+  std::mutex     flushLatch;    // protects the fields below
+  std::condition_variable flushCond; // signalled when there is work or on stop
+  bool           flushStop;     // tells the writer to exit
+  int            lowWater;      // writer cleans until this many frames are dirty
+  std::atomic<int> highWater;   // writer starts when more frames than this are dirty
+
+  const Status allocBuf(int & frame);   // allocate a free frame, returned latched and pinned
   const void releaseBuf(int frame); // return unused frame to end of list
-  void advanceClock()
+  const Status waitForFrame(File* file, const int PageNo,
+			    const int frame, Page*& page); // wait for a pinned frame to load
+  const Status fetchPages(File* file, const int firstPage, const int count,
+			  Page* pages[], const bool warm = false); // bring in (and pin) a range of pages
+  void readAheadFor(File* file, const int PageNo); // read ahead if file is read sequentially
+  void unPinPages(File* file, const int firstPage, const int count);
+  void dropPrefetched(BufDesc* tmpbuf); // count a read ahead page leaving the pool
+  void linkFrame(const int frame);   // add frame to its file's frameList
+  void unlinkFrame(const int frame); // take frame off its file's frameList
+  const Status writeRuns(int frames[], const int count); // write out dirty frames in page order
+  void setDirty(BufDesc* tmpbuf);   // mark a frame dirty
+  bool clearDirty(BufDesc* tmpbuf); // mark a frame clean, returns if it was dirty
+  const Status writeBack(const int frame); // write out a latched dirty frame
+  // the page in a frame is pinned through its file's mapping (see readPageRO)
+  bool mapPinned(const BufDesc* tmpbuf) const
+  {
+	File* file = tmpbuf->file;
+	return file->mapPinCnt != NULL && tmpbuf->pageNo < file->mapPages
+	    && file->mapPinCnt[tmpbuf->pageNo] > 0;
+  }
+  FileStats* statsFor(File* file);  // per file statistics, see dumpStats
+  mutable std::mutex fileStatsLatch; // protects fileStats
+  std::map<string, FileStats*> fileStats; // by file name
+  // hash table lookup, counted in BufStats; bucket latch held
+  Status lookupFrame(const File* file, const int pageNo, int& frameNo)
   {
-	clockHand = (clockHand + 1) % numBufs;
+	bufStats.lookups++;
+	return hashTable->lookup(file, pageNo, frameNo);
   }
+  // for PageHandle: pin by frame number, checking it still holds the
+  // page, and unpin without looking the page up
+  const Status rePinFrame(File* file, const int PageNo, const int frame);
+  void  unPinFrame(const int frame);
+  void  setFrameDirty(const int frame) { setDirty(&bufTable[frame]); }
+
+  friend class PageHandle;
+
+  // warm restart, see loadResident()
+  std::mutex     warmLatch;     // protects warmPages
+  std::map<string, std::vector<ResidentPage> > warmPages; // by file name
+  string         savePath;      // where the destructor saves the resident set
+
+  void runFlusher();                // body of the background writer
 
 
 public:
   Page*	         bufPool;   // actual buffer pool
 
-  BufMgr(const int bufs);
+  BufMgr(const int bufs, const ReplPolicy replPolicy = CLOCK,
+	 const PoolAlloc alloc = MMAPPOOL);
   ~BufMgr();
 
   const Status readPage(File* file, const int PageNo, Page*& page);
+  // read and pin pages firstPage .. firstPage+count-1, returned in pages[];
+  // pages not in the pool are read in batches of up to MAXREADRUN
+  const Status readPages(File* file, const int firstPage, const int count,
+			 Page* pages[]);
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
+  // pin a page for reading only.  If the file is mapped (File::mapFile)
+  // and the page is not in the pool, page points into the mapping and
+  // no frame is used; otherwise this is readPage.  Pages to be changed
+  // must be read with readPage, which copies them into a frame.
+  const Status readPageRO(File* file, const int PageNo, const Page*& page);
+  const Status unPinPageRO(File* file, const int PageNo, const Page* page);
   const Status allocPage(File* file, int& PageNo, Page*& page); 
                         // allocates a new, empty page 
+  // the same, returning the pin as a PageHandle (any page it held is
+  // unpinned first)
+  const Status readPage(File* file, const int PageNo, PageHandle& handle);
+  const Status allocPage(File* file, int& PageNo, PageHandle& handle);
+  const Status allocPages(File* file, const int count, int& firstPageNo,
+			  Page* pages[]); // allocates and pins count consecutive new pages
   const Status flushFile(const File* file); // writing out all dirty pages of the file
-  const Status disposePage(File* file, const int PageNo); // dispose of page in file
+  const Status disposePage(File* file, const int PageNo); // dispose of page in file,
+                        // unless it is pinned (PAGEPINNED)
   void  printSelf();
 
+  // start a background writer that, whenever more than highWater frames
+  // are dirty, writes out unpinned dirty frames in the order they are
+  // likely to be evicted until no more than lowWater are dirty
+  const Status startFlusher(const int lowWater, const int highWater);
+  void  stopFlusher(); // stop the background writer, if any
+
+  // once a file has been read sequentially SEQTHRESHOLD times in a row,
+  // keep the next pages (up to pages of them) in the pool; 0 turns it off
+  void  setReadAhead(const int pages)
+  {
+	readAhead = pages;
+  }
+
+  PoolAlloc getPoolAlloc() const // how the pool ended up being allocated
+  {
+	return poolAlloc;
+  }
+
   const BufStats & getBufStats() const // get buffer pool usage
   {
 	return bufStats;
   }
-  const void clearBufStats() 
+  const void clearBufStats(); // clears the per file statistics too
+  // drop the statistics of a file, which has been destroyed
+  void  forgetFile(const string& fileName);
+
+  // Warm restart.  saveResident writes the pages now in the pool to
+  // path, and loadResident reads such a list back; each file's pages
+  // are then brought in, batched and in page order, when DB::openFile
+  // calls warmFile for it (files already open can be passed to
+  // warmFile directly).  saveResidentAtExit has the destructor save
+  // the pages of the files still open.
+  const Status saveResident(const string& path);
+  const Status loadResident(const string& path);
+  void  warmFile(File* file);
+  void  saveResidentAtExit(const string& path)
   {
-	bufStats.clear();
+	savePath = path;
   }
+
+  // Write the statistics as a JSON object: the BufStats counters and
+  // histograms, gauges of the frames now pinned and dirty, and the
+  // counters of every file the pool has seen, by name.
+  void  dumpStats(ostream& out) const;
 };
 
 #endif
@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <functional>
+#include <mutex>
+#include <atomic>
 #include "error.h"
 #include <string.h>
 using namespace std;
@@ -14,21 +16,59 @@ using namespace std;
 
 // forward class definition for db
 class DB;
+struct FileStats;
+
+// structure of DB (header) page
+
+typedef struct {
+  int nextFree;                         // page # of next page on free list
+  int firstPage;                        // page # of first page in file
+  int numPages;                         // total # of pages in file
+} DBPage;
+
+// minimum number of pages a file is grown by when it runs out of room
+const int EXTENTPAGES = 64;
+
+// alignment O_DIRECT needs of buffers, file offsets and lengths
+const int DIRECTALIGN = 512;
+
+// how a memory mapped file is expected to be read, passed on to madvise
+enum AccessHint { NORMALACCESS, SEQUENTIALACCESS, RANDOMACCESS };
 
 // class definition for open files
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufMgr;
 
  public:
 
   Status allocatePage(int& pageNo);     // allocate a new page
+  Status allocatePages(const int count,
+		       int& firstPageNo);     // allocate count consecutive new pages
   const Status disposePage(const int pageNo);       // release space for a page
   const Status readPage(const int pageNo,
 		  Page* pagePtr) const;       // read page from file
   const Status writePage(const int pageNo,
 		   const Page* pagePtr);      // write page to file
+  const Status readPages(const int pageNo, const int count,
+		   Page* pagePtrs[], int& nread) const; // read consecutive pages
+  const Status writePages(const int pageNo, const int count,
+		   const Page* pagePtrs[]);   // write consecutive pages
   const Status getFirstPage(int& pageNo) const;     // returns pageNo of first page
+  const Status flush();                 // write the header page back if changed
+
+  // Map the pages allocated so far into memory, read only, so that
+  // they can be read without copying them into the buffer pool (see
+  // BufMgr::readPageRO).  Pages allocated later are read as usual.
+  const Status mapFile(const AccessHint hint);
+  const Status unmapFile();             // fails with PAGEPINNED while in use
+  const Page* mappedPage(const int pageNo) const; // NULL if not mapped
+
+  // Turn O_DIRECT on or off, bypassing the kernel page cache so that the
+  // buffer pool is the only cache.  Pages not aligned to DIRECTALIGN in
+  // memory are transferred through a bounce buffer.
+  const Status setDirectIO(const bool on);
 
   bool operator == (const File & other) const
     {
@@ -50,6 +90,7 @@ class File {
 		 Page* pagePtr) const;        // internal file read
   const Status intwrite(const int pageNo,
 		  const Page* pagePtr);       // internal file write
+  const Status extend(const int count); // make room for count more pages
 
 #ifdef DEBUGFREE
   void listFree();                      // list free pages
@@ -58,6 +99,30 @@ class File {
   string fileName;                    // The name of the file
   int openCnt;                        // # times file has been opened
   int unixFile;                       // unix file stream for file
+  mutable std::mutex hdrLatch;        // protects the fields below
+  DBPage header;                      // copy of the header page while open
+  bool hdrDirty;                      // header changed since last written
+  int extentEnd;                      // # pages the unix file has room for
+  bool directIO;                      // opened with O_DIRECT
+
+  // sequential access detection, maintained by BufMgr
+  std::atomic<int> lastRead;          // page last read
+  std::atomic<int> seqCnt;            // # of reads in a row that followed the previous one
+  std::atomic<int> raNext;            // first page past what was read ahead
+
+  // memory mapping, see mapFile()
+  char* mapBase;                      // start of the mapping, NULL if none
+  int mapPages;                       // # pages mapped
+  std::atomic<int> mapPins;           // # pages handed out of the mapping
+  std::atomic<int>* mapPinCnt;        // the same, per page
+
+  // buffer pool frames holding pages of this file, maintained by BufMgr
+  std::mutex frameLatch;              // protects frameList
+  int frameList;                      // first frame of the list, -1 if none
+
+  // statistics kept by a BufMgr, see BufMgr::statsFor
+  std::atomic<FileStats*> stats;      // entry of the pool below
+  std::atomic<unsigned long> statsPool; // BufMgr::poolId of the pool, 0 = none
 };
 
 class BufMgr;
@@ -114,12 +179,4 @@ class DB {
 };
 
 
-// structure of DB (header) page
-
-typedef struct {
-  int nextFree;                         // page # of next page on free list
-  int firstPage;                        // page # of first page in file
-  int numPages;                         // total # of pages in file
-} DBPage;
-
 #endif
@@ -3,6 +3,7 @@
 
 #include "error.h"
 #include "string.h"
+#include <stddef.h>
 
 struct RID{
     int  pageNo;
@@ -17,16 +18,31 @@ struct Record
   int length;
 };
 
+// Page size in bytes, fixed at compile time.  Build everything with
+// -DPAGEBYTES=4096 (8192, 16384, ...) for larger pages.
+#ifndef PAGEBYTES
+#define PAGEBYTES 1024
+#endif
+
+// offsets and lengths within a page, wide enough for any byte of it
+#if PAGEBYTES > 32768
+typedef int pageoff_t;
+#else
+typedef short pageoff_t;
+#endif
+
 // slot structure
 struct slot_t {
-        short	offset;  
-        short	length;  // equals -1 if slot is not in use
+        pageoff_t	offset;  
+        pageoff_t	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
-const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
+const unsigned PAGESIZE = PAGEBYTES;
+const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(pageoff_t)+2*sizeof(int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
+const unsigned MAXPAGERECS = PAGESIZE / sizeof(slot_t);
+// more records than fit on any page
 
 // Class definition for a minirel data page.   
 // The design assumes that records are kept compacted when
@@ -34,29 +50,39 @@ const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // array cannot be compacted.  Notice, this class does not keep
 // the records align, relying instead on upper levels to take
 // care of non-aligned attributes
+//
+// A page initialized as lazy instead leaves a hole behind when a
+// record is deleted and compacts only when an insert needs the room.
+// Its free slots are kept on a list, so inserts do not search for one.
 
 class Page {
 private:
     char 	data[PAGESIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
-    short	slotCnt; // number of slots in use;
-    short	freePtr; // offset of first free byte in data[]
-    short	freeSpace; // number of bytes free in data[]
-    short	dummy;	// for alignment purposes
+    pageoff_t	slotCnt; // number of slots in use;
+    pageoff_t	freePtr; // offset of first free byte in data[]
+    pageoff_t	freeSpace; // number of bytes free in data[]
+    pageoff_t	freeSlot; // 0 if kept compacted, else head of the
+    			  // free slot list (see page.C)
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
 
 public:
-    void init(const int pageNo); // initialize a new page
+    void init(const int pageNo, const bool lazy = false); // initialize a new page
     void dumpPage() const;       // dump contents of a page
 
     const Status getNextPage(int& pageNo) const; // returns value of nextPage
     const Status setNextPage(const int pageNo); // sets value of nextPage to pageNo
-    const short getFreeSpace() const; // returns amount of free space
+    const pageoff_t getFreeSpace() const; // returns amount of free space
 
     // inserts a new record (rec) into the page, returns RID of record 
     const Status insertRecord(const Record & rec, RID& rid);
 
+    // inserts recs[0..count-1] in one pass, stopping at the first that
+    // does not fit; returns NOSPACE unless all of them were inserted
+    const Status insertRecords(const Record recs[], const int count,
+			       RID rids[], int& inserted);
+
     // delete the record with the specified rid
     const Status deleteRecord(const RID & rid);
 
@@ -70,6 +96,31 @@ public:
 
     // returns reference to record with RID rid
     const Status getRecord(const RID & rid, Record & rec);
+
+    // fills recs[] (and rids[], unless NULL) with every record on the
+    // page, in slot order; both must hold MAXPAGERECS.  Returns the
+    // number of records.
+    int getRecords(Record recs[], RID rids[]) const;
+
+private:
+    // slot i (0, -1, -2, ...).  The slot array grows back into data[],
+    // past the one element declared, so it is addressed from the start
+    // of the page; indexing slot[] itself that way is undefined and
+    // gets miscompiled by optimizing compilers.
+    slot_t& slotAt(const int i)
+    {
+	return ((slot_t*)((char*)this + offsetof(Page, slot)))[i];
+    }
+    const slot_t& slotAt(const int i) const
+    {
+	return ((const slot_t*)((const char*)this + offsetof(Page, slot)))[i];
+    }
+
+    int contiguous() const; // bytes free between the records and slots
+    void compact();         // close up holes left by lazy deletes
+    void useSlot(const int i, const Record & rec, RID& rid);
 };
 
+static_assert(sizeof(Page) == PAGESIZE, "Page must be exactly PAGESIZE bytes");
+
 #endif
@@ -0,0 +1,53 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "page.h"
+#include "buf.h"
+
+// comparison operators for filters
+enum Operator { LT, LTE, EQ, GTE, GT, NE };
+
+// The records on one page of a file, as returned by FileScan::next.
+// They point into the page, which stays pinned until the next call.
+struct RecordBatch
+{
+  int     pageNo;               // page the records are on
+  int     count;                // number of records
+  Record  recs[MAXPAGERECS];
+  RID     rids[MAXPAGERECS];
+};
+
+// Scan of a file a page at a time, following the page chain from the
+// file's first page.  Pages are read with BufMgr::readPageRO, so a
+// mapped file is scanned without copying.
+class FileScan
+{
+ public:
+  FileScan(File* file);
+  ~FileScan();                          // unpins the current page
+
+  // next page with records on it; FILEEOF at the end of the file
+  const Status next(RecordBatch& batch);
+
+ private:
+  File*        file;
+  int          curPageNo;              // page pinned, -1 if none
+  const Page*  curPage;
+  int          nextPageNo;             // page to read next, -1 at end
+};
+
+// Filters over a batch.  Each puts the indexes in batch.recs of the
+// records that pass in sel[] (which must hold batch.count entries) and
+// returns how many passed.  Records too short to have the field fail.
+// With SSE2 (and without -DNOSIMD) four records are compared at once.
+
+// the int at offset compares to value as op says
+int filterInt(const RecordBatch& batch, const int offset,
+	      const Operator op, const int value, int sel[]);
+
+// the len bytes at offset are (EQ) or are not (NE) those at bytes
+int filterBytes(const RecordBatch& batch, const int offset,
+		const void* bytes, const int len, const Operator op,
+		int sel[]);
+
+#endif